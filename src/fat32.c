@@ -204,7 +204,7 @@ void WriteFile(BootSector *bs, unsigned char *buf, FileInfo *fi, FileEntry *fe,
          
          // Vide le cluster
          memset(buf, 0, 512);
-         for (x = 0; x < 8; x++)
+         for (x = 0; x < bs->SecPerClus; x++)
          {
             SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, GetSectorFromCluster(bs, fi->currentCluster) + x);
          }
@@ -340,6 +340,74 @@ unsigned char CleanFilename(char *filename)
 }
 
 
+/*---------------------------------------------------------------------------*-
+   IsValidNameChar ()
+  -----------------------------------------------------------------------------
+   Descriptif: Vérifie qu'un caractère est autorisé dans un nom court (8.3)
+
+   Entrée    : c : caractère à vérifier
+   Sortie    : 1 si le caractère est autorisé, autrement 0
+-*---------------------------------------------------------------------------*/
+static bit IsValidNameChar(unsigned char c)
+{
+   if (c < 0x20 || c == 0x7F) return 0;
+   if (strchr(INVALID_NAME_CHARS, c) != 0) return 0;
+   
+   return 1;
+}
+
+/*---------------------------------------------------------------------------*-
+   FormatFilename ()
+  -----------------------------------------------------------------------------
+   Descriptif: Inverse de CleanFilename, formate un nom de fichier (file.txt)
+               au format de la carte (FILE    TXT)
+
+   Entrée    : filename : nom du fichier
+               name : Tableau de 11 bytes pour le nom formaté
+   Sortie    : SUCCESS (1) ou FAILED (0) si le nom n'est pas un nom 8.3 valide
+-*---------------------------------------------------------------------------*/
+bit FormatFilename(char *filename, unsigned char *name)
+{
+   unsigned char xdata nameCnt = 0;
+   unsigned char xdata charCnt = 0;
+   
+   memset(name, ' ', 11);
+   
+   // Nom, jusqu'au point
+   while (filename[charCnt] != 0 && filename[charCnt] != '.')
+   {
+      if (nameCnt >= 8 || !IsValidNameChar(filename[charCnt])) return FAILED;
+      name[nameCnt++] = filename[charCnt++];
+   }
+   
+   // Extension
+   if (filename[charCnt] == '.')
+   {
+      charCnt++;
+      nameCnt = 8;
+      // Un deuxième point est refusé par IsValidNameChar
+      while (filename[charCnt] != 0)
+      {
+         if (nameCnt >= 11 || !IsValidNameChar(filename[charCnt])) return FAILED;
+         name[nameCnt++] = filename[charCnt++];
+      }
+   }
+   
+   // 0xE5 au début marque une entrée supprimée
+   if (name[0] == ' ' || name[0] == DELETED_ENTRY_MARK) return FAILED;
+   
+   // Si le charactere est une lettre en minuscule, la mettre en majuscule
+   for (nameCnt = 0; nameCnt < 11; nameCnt++)
+   {
+      if ( (name[nameCnt]>='a') && (name[nameCnt]<='z') )
+      {
+         name[nameCnt] -= 0x20;
+      }
+   }
+   
+   return SUCCESS;
+}
+
 /*---------------------------------------------------------------------------*-
    GetNextClusterValue ()
   -----------------------------------------------------------------------------
@@ -402,6 +470,62 @@ void SetNextClusterValue(BootSector *bs, unsigned char *buf, unsigned long clust
    }
 }
 
+/*---------------------------------------------------------------------------*-
+   SetClusterValue ()
+  -----------------------------------------------------------------------------
+   Descriptif: Ecris une valeur dans l'entrée d'un cluster, dans toutes les 
+               tables FAT
+
+   Entrée    : clusterNumber : Numéro du cluster à modifier
+               value : Valeur à écrire (cluster suivant, END_OF_FILE_MARK, 0)
+   Sortie    : --
+-*---------------------------------------------------------------------------*/
+void SetClusterValue(BootSector *bs, unsigned char *buf, unsigned long clusterNumber, unsigned long value)
+{
+   unsigned long xdata FATOffset = clusterNumber * 4;
+   unsigned long xdata sector = bs->RsvdSecCnt + (FATOffset / bs->BytsPerSec);
+   unsigned char x = 0;
+   
+   SwapEndianLONG(&value);
+   
+   for (x = 0; x < bs->NumFATs; x++)
+   {
+      SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, sector + (x * bs->FATSz32));
+      memcpy(buf+(FATOffset % bs->BytsPerSec), &value, 4);
+      SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, sector + (x * bs->FATSz32));
+   }
+}
+
+/*---------------------------------------------------------------------------*-
+   GetNextClusterCached ()
+  -----------------------------------------------------------------------------
+   Descriptif: Comme GetNextClusterValue, mais ne relis pas le secteur de la
+               table FAT s'il est déjà dans le buffer. Parcourir une chaîne 
+               ne coûte alors qu'une lecture par secteur de la table FAT.
+
+   Entrée    : buf : Buffer réservé à la table FAT
+               bufSector : Secteur actuellement dans buf (NO_SECTOR au départ)
+               clusterNumber : Valeur du cluster actuel
+   Sortie    : Valeur du cluster suivant
+-*---------------------------------------------------------------------------*/
+unsigned long GetNextClusterCached(BootSector *bs, unsigned char *buf, unsigned long *bufSector, unsigned long clusterNumber)
+{
+   unsigned long xdata FATOffset = clusterNumber * 4;
+   unsigned long xdata sector = bs->RsvdSecCnt + (FATOffset / bs->BytsPerSec);
+   unsigned long xdata nextClusterNumber = 0;
+   
+   if (*bufSector != sector)
+   {
+      SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+      *bufSector = sector;
+   }
+   
+   memcpy(&nextClusterNumber, buf+(FATOffset % bs->BytsPerSec), 4);
+   SwapEndianLONG(&nextClusterNumber);
+   
+   return nextClusterNumber;
+}
+
 /*---------------------------------------------------------------------------*-
    GetSectorFromCluster ()
   -----------------------------------------------------------------------------
@@ -415,6 +539,28 @@ unsigned long GetSectorFromCluster(BootSector *bs, unsigned long cluster)
    return (cluster - 2) * bs->SecPerClus + bs->RootDirSector;
 }
 
+/*---------------------------------------------------------------------------*-
+   GetMaxCluster ()
+  -----------------------------------------------------------------------------
+   Descriptif: Retourne le premier numéro de cluster après la fin du volume.
+               La table FAT peut contenir plus d'entrées que de clusters 
+               (FormatVolume l'arrondit à l'erase block).
+
+   Entrée    : bs : Contenu du boot sector
+   Sortie    : Numéro du dernier cluster valide + 1
+-*---------------------------------------------------------------------------*/
+unsigned long GetMaxCluster(BootSector *bs)
+{
+   unsigned long xdata maxCluster = (bs->TotSec32 - bs->RootDirSector) / bs->SecPerClus + 2;
+   
+   if (maxCluster > bs->FATSz32 * (bs->BytsPerSec / 4))
+   {
+      maxCluster = bs->FATSz32 * (bs->BytsPerSec / 4);
+   }
+   
+   return maxCluster;
+}
+
 /*---------------------------------------------------------------------------*-
    FindFreeCluster ()
   -----------------------------------------------------------------------------
@@ -450,6 +596,76 @@ unsigned long FindFreeCluster(BootSector *bs, unsigned char *buf)
 }
 
 
+/*---------------------------------------------------------------------------*-
+   FindFreeClusterRun ()
+  -----------------------------------------------------------------------------
+   Descriptif: Cherche dans la table FAT une suite de clusters vides
+               consécutifs. La table est lue de manière séquentielle.
+
+   Entrée    : bs : Contenu du boot sector
+               buf : Buffer pour stocker le contenu du secteur
+               nbClusters : Nombre de clusters consécutifs voulus
+   Sortie    : Premier cluster de la suite, 0xFFFFFFFF si pas trouvé
+-*---------------------------------------------------------------------------*/
+unsigned long FindFreeClusterRun(BootSector *bs, unsigned char *buf, unsigned long nbClusters)
+{
+   unsigned long xdata maxCluster = GetMaxCluster(bs);
+   unsigned long xdata sector = 0, cluster = 0, clusterValue = 0;
+   unsigned long xdata runStart = 0, runLength = 0;
+   unsigned int xdata x = 0;
+   
+   for (sector = 0; sector < bs->FATSz32; sector++)
+   {
+      SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, bs->RsvdSecCnt + sector);
+      
+      for (x = 0; x < (bs->BytsPerSec / 4); x++)
+      {
+         cluster = sector * (bs->BytsPerSec / 4) + x;
+         
+         // Entrées après la fin de la zone de données
+         if (cluster >= maxCluster) return 0xFFFFFFFF;
+         if (cluster < 2) continue;
+         
+         memcpy(&clusterValue, buf+(x*4), 4);
+         
+         if (clusterValue == 0)
+         {
+            if (runLength == 0) runStart = cluster;
+            if (++runLength == nbClusters) return runStart;
+         }
+         else
+         {
+            runLength = 0;
+         }
+      }
+   }
+   
+   return 0xFFFFFFFF; // PAS DE CLUSTERS VIDES
+}
+
+/*---------------------------------------------------------------------------*-
+   FreeClusterChain ()
+  -----------------------------------------------------------------------------
+   Descriptif: Libère tous les clusters d'une chaîne dans les tables FAT
+
+   Entrée    : bs : Contenu du boot sector
+               buf : Buffer pour stocker le contenu du secteur
+               cluster : Premier cluster de la chaîne
+   Sortie    : --
+-*---------------------------------------------------------------------------*/
+void FreeClusterChain(BootSector *bs, unsigned char *buf, unsigned long cluster)
+{
+   unsigned long xdata next = 0;
+   
+   // Un cluster déjà libre (0) termine aussi une chaîne qui boucle
+   while (cluster >= 2 && cluster < END_OF_CHAIN_MIN)
+   {
+      next = GetNextClusterValue(bs, buf, cluster) & CLUSTER_MASK;
+      SetClusterValue(bs, buf, cluster, 0);
+      cluster = next;
+   }
+}
+
 /*---------------------------------------------------------------------------*-
    FindFileEntry ()
   -----------------------------------------------------------------------------
@@ -497,6 +713,45 @@ unsigned int FindFileEntry(BootSector *bs, char *buf, unsigned long secteurDepar
 }
 
 
+/*---------------------------------------------------------------------------*-
+   FindFreeEntry ()
+  -----------------------------------------------------------------------------
+   Descriptif: Cherche dans un dossier une entrée libre (supprimée ou après
+               la dernière entrée)
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour écrire le contenu du secteur
+               secteurDepart : Commence à chercher à ce secteur puis continu sur 1 cluster
+   Sortie    : Offset de l'entrée depuis le début du cluster, NO_ENTRY si 
+               le dossier est plein
+
+   info : L'offset 0 de la racine est réservé au nom du volume, comme 
+   dans ListFilesDirectory.
+-*---------------------------------------------------------------------------*/
+unsigned int FindFreeEntry(BootSector *bs, unsigned char *buf, unsigned long secteurDepart)
+{
+   unsigned int xdata offset = 0, start = 0;
+   unsigned char xdata secteur = 0;
+   
+   if (secteurDepart == bs->RootDirSector) start = 32;
+   
+   for (secteur = 0; secteur < bs->SecPerClus; secteur++)
+   {
+      SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + secteur);
+      
+      for (offset = start; offset < 512; offset+=32)
+      {
+         if (buf[offset] == 0x00 || buf[offset] == DELETED_ENTRY_MARK)
+         {
+            return offset + (secteur * 512);
+         }
+      }
+      start = 0;
+   }
+   
+   return NO_ENTRY;
+}
+
 /*---------------------------------------------------------------------------*-
    ListFilesDirectory ()
   -----------------------------------------------------------------------------
@@ -562,12 +817,147 @@ BootSector ParseBootSector(unsigned char *buf)
    PARSE_INFO_CHAR(bootSector, NumFATs   , buf, NUMFATS_OFFSET)
    PARSE_INFO_LONG(bootSector, FATSz32   , buf, FATSz32_OFFSET)
    PARSE_INFO_LONG(bootSector, RootClus  , buf, ROOTCLUS_OFFSET)
+   PARSE_INFO_LONG(bootSector, TotSec32  , buf, TOTSEC32_OFFSET)
    
    bootSector.RootDirSector = bootSector.RsvdSecCnt + (bootSector.NumFATs * bootSector.FATSz32);
    
    return bootSector;
 }
 
+/*---------------------------------------------------------------------------*-
+   FormatVolume ()
+  -----------------------------------------------------------------------------
+   Descriptif: Formate le volume en FAT32, Boot Sector au secteur 0.
+               Les tables FAT et la zone de données commencent sur une 
+               limite d'erase block (allocation unit de la carte SD), la
+               taille des clusters est choisie selon la taille du volume.
+               Seules les tables FAT et la racine sont mises à zéro.
+
+   Entrée    : buf : Buffer pour écrire le contenu du secteur
+               totalSectors : Nombre de secteurs du volume
+               eraseBlockSectors : Taille d'un erase block en secteur 
+                                   (8192 pour 4 MB)
+   Sortie    : SUCCESS (1) ou FAILED (0) si le volume est trop petit
+-*---------------------------------------------------------------------------*/
+bit FormatVolume(unsigned char *buf, unsigned long totalSectors, unsigned long eraseBlockSectors)
+{
+   unsigned long xdata rsvdSecCnt = 0, FATSz32 = 0, dataSector = 0;
+   unsigned long xdata nbClusters = 0, sector = 0;
+   unsigned long xdata valLong = 0;
+   unsigned int xdata valInt = 0;
+   unsigned char xdata secPerClus = 0, x = 0;
+   
+   if (eraseBlockSectors == 0) eraseBlockSectors = 1;
+   
+   // Taille des clusters selon la taille du volume
+   if      (totalSectors <= 532480UL)   secPerClus = 1;  // 260 MB : 512 B
+   else if (totalSectors <= 16777216UL) secPerClus = 8;  // 8 GB   : 4 KB
+   else if (totalSectors <= 33554432UL) secPerClus = 16; // 16 GB  : 8 KB
+   else if (totalSectors <= 67108864UL) secPerClus = 32; // 32 GB  : 16 KB
+   else                                 secPerClus = 64; //        : 32 KB
+   
+   // La première table FAT commence sur un erase block
+   rsvdSecCnt = ((MIN_RSVD_SECTORS + eraseBlockSectors - 1) / eraseBlockSectors) * eraseBlockSectors;
+   if (rsvdSecCnt > 0xFFFF || rsvdSecCnt >= totalSectors) return FAILED;
+   
+   // Taille d'une table FAT arrondie à l'erase block, la deuxième table
+   // et la zone de données sont donc aussi alignées
+   nbClusters = (totalSectors - rsvdSecCnt) / secPerClus;
+   FATSz32 = ((nbClusters + 2) * 4 + NB_BYTES_SECTOR - 1) / NB_BYTES_SECTOR;
+   FATSz32 = ((FATSz32 + eraseBlockSectors - 1) / eraseBlockSectors) * eraseBlockSectors;
+   
+   dataSector = rsvdSecCnt + 2 * FATSz32;
+   if (dataSector >= totalSectors) return FAILED;
+   
+   nbClusters = (totalSectors - dataSector) / secPerClus;
+   if (nbClusters < MIN_FAT32_CLUSTERS) return FAILED;
+   
+   // TABLES FAT
+   // Ecriture séquentielle des deux tables
+   memset(buf, 0, NB_BYTES_SECTOR);
+   for (x = 0; x < 2; x++)
+   {
+      // Clusters 0 et 1 réservés, cluster 2 : racine
+      valLong = 0x0FFFFFF8;
+      STORE_INFO_LONG(valLong, buf, 0)
+      valLong = END_OF_FILE_MARK;
+      STORE_INFO_LONG(valLong, buf, 4)
+      STORE_INFO_LONG(valLong, buf, 8)
+      SD_WriteBlock(TOKEN_RW, buf, NB_BYTES_SECTOR, rsvdSecCnt + (x * FATSz32));
+      memset(buf, 0, 12);
+      
+      for (sector = 1; sector < FATSz32; sector++)
+      {
+         SD_WriteBlock(TOKEN_RW, buf, NB_BYTES_SECTOR, rsvdSecCnt + (x * FATSz32) + sector);
+      }
+   }
+   
+   // RACINE
+   // Entrée du nom de volume à l'offset 0, même nom que VolLab
+   memcpy(buf, DEFAULT_VOLUME_LABEL, 11);
+   buf[ATTR_OFFSET] = ATTR_VOLUME_ID;
+   SD_WriteBlock(TOKEN_RW, buf, NB_BYTES_SECTOR, dataSector);
+   memset(buf, 0, 32);
+   
+   for (x = 1; x < secPerClus; x++)
+   {
+      SD_WriteBlock(TOKEN_RW, buf, NB_BYTES_SECTOR, dataSector + x);
+   }
+   
+   // FSINFO
+   valLong = FSI_LEADSIG;
+   STORE_INFO_LONG(valLong, buf, FSI_LEADSIG_OFFSET)
+   valLong = FSI_STRUCSIG;
+   STORE_INFO_LONG(valLong, buf, FSI_STRUCSIG_OFFSET)
+   // Les fonctions d'écriture ne tiennent pas le FSInfo à jour,
+   // nombre de clusters libres et prochain cluster libre inconnus
+   valLong = FSI_UNKNOWN;
+   STORE_INFO_LONG(valLong, buf, FSI_FREECOUNT_OFFSET)
+   STORE_INFO_LONG(valLong, buf, FSI_NXTFREE_OFFSET)
+   valLong = FSI_TRAILSIG;
+   STORE_INFO_LONG(valLong, buf, FSI_TRAILSIG_OFFSET)
+   SD_WriteBlock(TOKEN_RW, buf, NB_BYTES_SECTOR, FSINFO_SECTOR);
+   SD_WriteBlock(TOKEN_RW, buf, NB_BYTES_SECTOR, BACKUP_BOOT_SECTOR + FSINFO_SECTOR);
+   
+   // BOOT SECTOR
+   memset(buf, 0, NB_BYTES_SECTOR);
+   memcpy(buf, "\xEB\x58\x90" "MSWIN4.1", 11);
+   valInt = NB_BYTES_SECTOR;
+   STORE_INFO_INT (valInt, buf, BYTSPERSEC_OFFSET)
+   buf[SECPERCLUS_OFFSET] = secPerClus;
+   valInt = rsvdSecCnt;
+   STORE_INFO_INT (valInt, buf, RSVDSECCNT_OFFSET)
+   buf[NUMFATS_OFFSET] = 2;
+   buf[MEDIA_OFFSET] = 0xF8;
+   valInt = 63;
+   STORE_INFO_INT (valInt, buf, SECPERTRK_OFFSET)
+   valInt = 255;
+   STORE_INFO_INT (valInt, buf, NUMHEADS_OFFSET)
+   STORE_INFO_LONG(totalSectors, buf, TOTSEC32_OFFSET)
+   STORE_INFO_LONG(FATSz32, buf, FATSz32_OFFSET)
+   valLong = 2;
+   STORE_INFO_LONG(valLong, buf, ROOTCLUS_OFFSET)
+   valInt = FSINFO_SECTOR;
+   STORE_INFO_INT (valInt, buf, FSINFO_OFFSET)
+   valInt = BACKUP_BOOT_SECTOR;
+   STORE_INFO_INT (valInt, buf, BKBOOTSEC_OFFSET)
+   buf[DRVNUM_OFFSET] = 0x80;
+   buf[BOOTSIG_OFFSET] = 0x29;
+   valLong = totalSectors ^ 0x46415433; // Pas d'horloge, identifiant dérivé de la taille
+   STORE_INFO_LONG(valLong, buf, VOLID_OFFSET)
+   memcpy(buf + VOLLAB_OFFSET, DEFAULT_VOLUME_LABEL, 11);
+   memcpy(buf + FILSYSTYPE_OFFSET, "FAT32   ", 8);
+   buf[SIGNATURE_OFFSET] = 0x55;
+   buf[SIGNATURE_OFFSET + 1] = 0xAA;
+   
+   // Le secteur 0 est écrit en dernier, un formatage interrompu
+   // ne laisse pas un volume qui semble valide
+   SD_WriteBlock(TOKEN_RW, buf, NB_BYTES_SECTOR, BACKUP_BOOT_SECTOR);
+   SD_WriteBlock(TOKEN_RW, buf, NB_BYTES_SECTOR, 0);
+   
+   return SUCCESS;
+}
+
 /*---------------------------------------------------------------------------*-
    ReadFileEntry ()
   -----------------------------------------------------------------------------
@@ -598,3 +988,1078 @@ FileEntry ReadFileEntry(unsigned char *buf, unsigned int offset)
    
    return tempFile;
 }
+
+
+/*---------------------------------------------------------------------------*-
+   CompareFATCopies ()
+  -----------------------------------------------------------------------------
+   Descriptif: Compare la première table FAT avec ses copies, secteur par 
+               secteur. SetNextClusterValue écrit la table 0 en premier, elle
+               est donc la référence en cas de coupure de courant.
+
+   Entrée    : buf : Buffer pour le secteur de la table 0
+               buf2 : Buffer pour le secteur de la copie
+               firstSector : Premier secteur à comparer (depuis le début de la table)
+               nbSectors : Nombre de secteurs à comparer
+               repair : 1 pour réécrire les copies différentes avec la table 0
+   Sortie    : Nombre de secteurs différents
+-*---------------------------------------------------------------------------*/
+unsigned long CompareFATCopies(BootSector *bs, unsigned char *buf, unsigned char *buf2, unsigned long firstSector, unsigned long nbSectors, bit repair)
+{
+   unsigned long xdata sector = 0;
+   unsigned long xdata mismatch = 0;
+   unsigned char x = 0;
+   
+   for (sector = firstSector; sector < firstSector + nbSectors; sector++)
+   {
+      SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, bs->RsvdSecCnt + sector);
+      
+      for (x = 1; x < bs->NumFATs; x++)
+      {
+         SD_ReadBlock(TOKEN_RW, buf2, bs->BytsPerSec, bs->RsvdSecCnt + sector + (x * bs->FATSz32));
+         
+         if (memcmp(buf, buf2, bs->BytsPerSec) != 0)
+         {
+            mismatch++;
+            if (repair)
+            {
+               SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, bs->RsvdSecCnt + sector + (x * bs->FATSz32));
+            }
+         }
+      }
+   }
+   
+   return mismatch;
+}
+
+/*---------------------------------------------------------------------------*-
+   CheckChain ()
+  -----------------------------------------------------------------------------
+   Descriptif: Parcours la chaîne d'un fichier et marque ses clusters dans le
+               bitmap. S'arrête au premier cluster déjà marqué ou invalide.
+
+   Entrée    : fatBuf : Buffer réservé à la table FAT
+               fatSector : Secteur actuellement dans fatBuf
+               bitmap : 1 bit par cluster de la région vérifiée
+               firstCluster, nbClusters : Région vérifiée
+               cluster : Premier cluster de la chaîne
+               needed : Nombre de clusters attendu (CHAIN_ANY_LENGTH si inconnu)
+               spare : 1 si un cluster de plus est accepté en fin de chaîne
+               kept : Nombre de clusters valides dans la chaîne
+               last : Dernier cluster valide de la chaîne
+   Sortie    : CHAIN_OK, CHAIN_SHORT, CHAIN_TOO_LONG, CHAIN_BROKEN ou CHAIN_CROSSLINKED
+-*---------------------------------------------------------------------------*/
+static unsigned char CheckChain(BootSector *bs, unsigned char *fatBuf, unsigned long *fatSector,
+                                unsigned char *bitmap, unsigned long firstCluster, unsigned long nbClusters,
+                                unsigned long cluster, unsigned long needed, bit spare,
+                                unsigned long *kept, unsigned long *last)
+{
+   unsigned long xdata maxCluster = GetMaxCluster(bs);
+   unsigned long xdata index = 0;
+   
+   *kept = 0;
+   *last = 0;
+   
+   if (cluster == 0) return (needed == 0) ? CHAIN_OK : CHAIN_SHORT;
+   if (needed == 0 && !spare) return CHAIN_TOO_LONG;
+   
+   while (1)
+   {
+      // Cluster libre, réservé ou boucle en dehors de la région
+      if (cluster < 2 || cluster >= maxCluster || *kept >= maxCluster) return CHAIN_BROKEN;
+      
+      index = cluster - firstCluster;
+      if (cluster >= firstCluster && index < nbClusters)
+      {
+         if (bitmap[index >> 3] & (1 << (index & 7))) return CHAIN_CROSSLINKED;
+         bitmap[index >> 3] |= (1 << (index & 7));
+      }
+      
+      (*kept)++;
+      *last = cluster;
+      
+      cluster = GetNextClusterCached(bs, fatBuf, fatSector, cluster) & CLUSTER_MASK;
+      
+      if (cluster >= END_OF_CHAIN_MIN)
+      {
+         if (needed != CHAIN_ANY_LENGTH && *kept < needed) return CHAIN_SHORT;
+         return CHAIN_OK;
+      }
+      
+      // Les clusters en trop ne sont pas marqués, ils seront comptés perdus
+      if (*kept == needed + spare) return CHAIN_TOO_LONG;
+   }
+}
+
+/*---------------------------------------------------------------------------*-
+   RepairEntry ()
+  -----------------------------------------------------------------------------
+   Descriptif: Corrige une entrée après CheckChain. La chaîne est coupée 
+               après le dernier cluster valide et la taille est réduite à
+               ce qui reste dans la chaîne.
+
+   Entrée    : buf : Buffer qui contient le secteur de l'entrée
+               fatBuf : Buffer réservé à la table FAT
+               dirSector : Secteur de l'entrée
+               entryOffset : Offset de l'entrée dans le secteur
+               status, kept, last : Résultat de CheckChain
+               isDir : 1 si l'entrée est un dossier
+   Sortie    : --
+-*---------------------------------------------------------------------------*/
+static void RepairEntry(BootSector *bs, unsigned char *buf, unsigned char *fatBuf, unsigned long dirSector,
+                        unsigned int entryOffset, unsigned char status, unsigned long kept, unsigned long last, bit isDir)
+{
+   unsigned long xdata clusBytes = (unsigned long)bs->BytsPerSec * bs->SecPerClus;
+   unsigned long xdata size = 0;
+   unsigned int xdata clusHi = 0, clusLo = 0;
+   
+   memcpy(&size, buf + entryOffset + FILESIZE_OFFSET, 4);
+   SwapEndianLONG(&size);
+   
+   if (kept == 0)
+   {
+      if (isDir)
+      {
+         buf[entryOffset] = DELETED_ENTRY_MARK;
+      }
+      else
+      {
+         // Fichier vide, les clusters éventuels seront libérés
+         size = 0;
+         STORE_INFO_INT (clusHi, buf, entryOffset + FSTCLUSHI_OFFSET)
+         STORE_INFO_INT (clusLo, buf, entryOffset + FSTCLUSLO_OFFSET)
+         STORE_INFO_LONG(size,   buf, entryOffset + FILESIZE_OFFSET)
+      }
+   }
+   else
+   {
+      if (status != CHAIN_SHORT)
+      {
+         SetClusterValue(bs, fatBuf, last, END_OF_FILE_MARK);
+      }
+      
+      if (!isDir && size > kept * clusBytes)
+      {
+         size = kept * clusBytes;
+         STORE_INFO_LONG(size, buf, entryOffset + FILESIZE_OFFSET)
+      }
+   }
+   
+   SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, dirSector);
+}
+
+/*---------------------------------------------------------------------------*-
+   CheckVolume ()
+  -----------------------------------------------------------------------------
+   Descriptif: Vérifie la cohérence du volume après une coupure de courant :
+               copies de la table FAT, chaînes qui se croisent, chaînes 
+               cassées, taille des fichiers et clusters perdus.
+               
+               Le bitmap contient 1 bit par cluster de la région vérifiée.
+               Pour vérifier tout le volume, firstCluster = 2 et nbClusters
+               = nombre de clusters. Sur la cible, une région plus petite
+               permet de garder un bitmap qui tient en mémoire.
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour les secteurs des dossiers
+               fatBuf : Buffer pour les secteurs de la table FAT
+               bitmap : Tableau de (nbClusters + 7) / 8 bytes
+               firstCluster : Premier cluster de la région vérifiée
+               nbClusters : Nombre de clusters de la région vérifiée
+               repair : 1 pour corriger les erreurs trouvées
+   Sortie    : Struct CheckReport, nombre d'erreurs trouvées
+               checkedClusters = 0 si la région est invalide
+
+   info : Les clusters perdus ne sont pas libérés si un dossier n'a pas 
+   pu être vérifié (trop profond), ses fichiers n'étant pas marqués.
+-*---------------------------------------------------------------------------*/
+CheckReport CheckVolume(BootSector *bs, unsigned char *buf, unsigned char *fatBuf, unsigned char *bitmap, unsigned long firstCluster, unsigned long nbClusters, bit repair)
+{
+   CheckReport xdata report;
+   DirCursor xdata stack[CHECK_MAX_DEPTH];
+   DirCursor xdata cur;
+   FileEntry xdata fe;
+   unsigned char xdata depth = 0, status = 0, attr = 0;
+   unsigned int xdata entryOffset = 0, x = 0;
+   unsigned long xdata fatSector = NO_SECTOR, loadedSector = NO_SECTOR;
+   unsigned long xdata firstFatSector = 0, nbFatSectors = 0, maxCluster = 0;
+   unsigned long xdata dirSector = 0, sector = 0;
+   unsigned long xdata cluster = 0, needed = 0, kept = 0, last = 0, value = 0, index = 0;
+   unsigned long xdata clusBytes = (unsigned long)bs->BytsPerSec * bs->SecPerClus;
+   bit modified = 0, spare = 0;
+   
+   memset(&report, 0, sizeof(report));
+   
+   // Région limitée aux clusters du volume
+   maxCluster = GetMaxCluster(bs);
+   if (firstCluster < 2 || firstCluster >= maxCluster || nbClusters == 0) return report;
+   if (nbClusters > maxCluster - firstCluster) nbClusters = maxCluster - firstCluster;
+   report.checkedClusters = nbClusters;
+   
+   // Secteurs de la table FAT qui couvrent la région
+   firstFatSector = (firstCluster * 4) / bs->BytsPerSec;
+   nbFatSectors = (((firstCluster + nbClusters - 1) * 4) / bs->BytsPerSec) - firstFatSector + 1;
+   
+   // COPIES DE LA TABLE FAT
+   report.fatMismatch = CompareFATCopies(bs, buf, fatBuf, firstFatSector, nbFatSectors, repair);
+   
+   memset(bitmap, 0, (nbClusters + 7) / 8);
+   
+   // CHAINE DE LA RACINE
+   status = CheckChain(bs, fatBuf, &fatSector, bitmap, firstCluster, nbClusters, bs->RootClus, CHAIN_ANY_LENGTH, 0, &kept, &last);
+   if (status == CHAIN_CROSSLINKED) report.crossLinked++;
+   if (status == CHAIN_BROKEN) report.brokenChains++;
+   if (status != CHAIN_OK && repair && kept != 0)
+   {
+      SetClusterValue(bs, fatBuf, last, END_OF_FILE_MARK);
+      fatSector = NO_SECTOR;
+   }
+   
+   cur.cluster = bs->RootClus;
+   cur.remaining = kept;
+   cur.sector = 0;
+   cur.offset = 0;
+   
+   // PARCOURS DES DOSSIERS
+   while (1)
+   {
+      // Fin du dossier, retourne au dossier parent
+      if (cur.remaining == 0)
+      {
+         if (depth == 0) break;
+         depth--;
+         cur = stack[depth];
+         continue;
+      }
+      
+      // Fin du secteur
+      if (cur.offset >= bs->BytsPerSec)
+      {
+         cur.offset = 0;
+         cur.sector++;
+      }
+      
+      // Fin du cluster
+      if (cur.sector >= bs->SecPerClus)
+      {
+         cur.sector = 0;
+         if (--cur.remaining != 0)
+         {
+            cur.cluster = GetNextClusterCached(bs, fatBuf, &fatSector, cur.cluster) & CLUSTER_MASK;
+         }
+         continue;
+      }
+      
+      dirSector = GetSectorFromCluster(bs, cur.cluster) + cur.sector;
+      if (dirSector != loadedSector)
+      {
+         SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, dirSector);
+         loadedSector = dirSector;
+      }
+      
+      entryOffset = cur.offset;
+      cur.offset += 32;
+      
+      if (buf[entryOffset] == 0x00)               // Fin des entrées
+      {
+         cur.remaining = 0;
+         continue;
+      }
+      if (buf[entryOffset] == DELETED_ENTRY_MARK) continue; // Fichier supprimé
+      if (buf[entryOffset] == '.') continue;                // Entrées . et ..
+      
+      attr = buf[entryOffset + ATTR_OFFSET];
+      if ((attr & ATTR_LONG_NAME) == ATTR_LONG_NAME) continue;
+      if (attr & ATTR_VOLUME_ID) continue;
+      
+      fe = ReadFileEntry(buf, entryOffset);
+      cluster = ((unsigned long)fe.FstClusHi << 16) | fe.FstClusLO;
+      
+      if (attr & ATTR_DIRECTORY)
+      {
+         needed = CHAIN_ANY_LENGTH;
+         spare = 0;
+      }
+      else
+      {
+         // WriteFile alloue un cluster d'avance quand le fichier se termine
+         // sur une limite de cluster, ce cluster fait partie du fichier
+         needed = (fe.fileSize / clusBytes) + ((fe.fileSize % clusBytes) != 0);
+         spare = (fe.fileSize % clusBytes) == 0;
+      }
+      
+      status = CheckChain(bs, fatBuf, &fatSector, bitmap, firstCluster, nbClusters, cluster, needed, spare, &kept, &last);
+      
+      if (status == CHAIN_CROSSLINKED) report.crossLinked++;
+      else if (status == CHAIN_BROKEN) report.brokenChains++;
+      else if (status != CHAIN_OK) report.sizeMismatch++;
+      
+      if (status != CHAIN_OK && repair)
+      {
+         RepairEntry(bs, buf, fatBuf, dirSector, entryOffset, status, kept, last, (attr & ATTR_DIRECTORY) != 0);
+         fatSector = NO_SECTOR;
+      }
+      
+      // Descend dans le sous-dossier
+      if ((attr & ATTR_DIRECTORY) && kept != 0)
+      {
+         if (depth < CHECK_MAX_DEPTH)
+         {
+            stack[depth] = cur;
+            depth++;
+            cur.cluster = cluster;
+            cur.remaining = kept;
+            cur.sector = 0;
+            cur.offset = 0;
+         }
+         else
+         {
+            report.skippedDirs++;
+         }
+      }
+   }
+   
+   // CLUSTERS PERDUS
+   // Lecture séquentielle de la table FAT, 1 secteur = BytsPerSec / 4 clusters
+   for (sector = firstFatSector; sector < firstFatSector + nbFatSectors; sector++)
+   {
+      SD_ReadBlock(TOKEN_RW, fatBuf, bs->BytsPerSec, bs->RsvdSecCnt + sector);
+      modified = 0;
+      
+      for (x = 0; x < (bs->BytsPerSec / 4); x++)
+      {
+         cluster = sector * (bs->BytsPerSec / 4) + x;
+         index = cluster - firstCluster;
+         
+         if (cluster < 2 || cluster < firstCluster || index >= nbClusters) continue;
+         if (bitmap[index >> 3] & (1 << (index & 7))) continue;
+         
+         memcpy(&value, fatBuf+(x*4), 4);
+         SwapEndianLONG(&value);
+         value &= CLUSTER_MASK;
+         
+         if (value == 0 || value == BAD_CLUSTER_MARK) continue;
+         
+         report.lostClusters++;
+         if (repair && report.skippedDirs == 0)
+         {
+            memset(fatBuf+(x*4), 0, 4);
+            modified = 1;
+         }
+      }
+      
+      if (modified)
+      {
+         for (x = 0; x < bs->NumFATs; x++)
+         {
+            SD_WriteBlock(TOKEN_RW, fatBuf, bs->BytsPerSec, bs->RsvdSecCnt + sector + (x * bs->FATSz32));
+         }
+      }
+   }
+   
+   return report;
+}
+
+
+/*---------------------------------------------------------------------------*-
+   LinkClusterRun ()
+  -----------------------------------------------------------------------------
+   Descriptif: Chaîne une suite de clusters consécutifs dans toutes les 
+               tables FAT. Chaque secteur de la table n'est écrit qu'une fois.
+
+   Entrée    : buf : Buffer pour stocker le contenu du secteur
+               first : Premier cluster de la suite
+               nbClusters : Nombre de clusters
+   Sortie    : --
+-*---------------------------------------------------------------------------*/
+static void LinkClusterRun(BootSector *bs, unsigned char *buf, unsigned long first, unsigned long nbClusters)
+{
+   unsigned long xdata perSector = bs->BytsPerSec / 4;
+   unsigned long xdata last = first + nbClusters - 1;
+   unsigned long xdata sector = 0, cluster = 0, value = 0;
+   unsigned char x = 0;
+   
+   for (sector = first / perSector; sector <= last / perSector; sector++)
+   {
+      for (x = 0; x < bs->NumFATs; x++)
+      {
+         SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, bs->RsvdSecCnt + sector + (x * bs->FATSz32));
+         
+         cluster = (sector * perSector > first) ? sector * perSector : first;
+         for (; cluster <= last && cluster < (sector + 1) * perSector; cluster++)
+         {
+            value = (cluster == last) ? END_OF_FILE_MARK : cluster + 1;
+            SwapEndianLONG(&value);
+            memcpy(buf+((cluster % perSector) * 4), &value, 4);
+         }
+         
+         SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, bs->RsvdSecCnt + sector + (x * bs->FATSz32));
+      }
+   }
+}
+
+/*---------------------------------------------------------------------------*-
+   WriteRingHeader ()
+  -----------------------------------------------------------------------------
+   Descriptif: Ecris l'en-tête du fichier circulaire dans son premier secteur
+
+   Entrée    : buf : Buffer pour écrire le contenu du secteur
+               ring : Fichier circulaire
+   Sortie    : --
+-*---------------------------------------------------------------------------*/
+static void WriteRingHeader(BootSector *bs, unsigned char *buf, RingFile *ring)
+{
+   memset(buf, 0, bs->BytsPerSec);
+   memcpy(buf + RING_MAGIC_OFFSET, RING_MAGIC, 4);
+   STORE_INFO_INT (ring->recordSize, buf, RING_RECSIZE_OFFSET)
+   STORE_INFO_LONG(ring->capacity,   buf, RING_CAPACITY_OFFSET)
+   STORE_INFO_LONG(ring->seq,        buf, RING_SEQ_OFFSET)
+   SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, ring->headerSector);
+}
+
+/*---------------------------------------------------------------------------*-
+   RingCreate ()
+  -----------------------------------------------------------------------------
+   Descriptif: Transforme un fichier existant en fichier circulaire. Le 
+               fichier reçoit une chaîne de clusters consécutifs, l'ancienne
+               chaîne est libérée. Le premier secteur contient l'en-tête, 
+               les suivants les enregistrements.
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour écrire le contenu du secteur
+               secteurDepart : Premier secteur du dossier du fichier
+               filename : nom du fichier
+               ring : Fichier circulaire à initialiser
+               nbClusters : Taille du fichier en clusters
+               recordSize : Taille d'un enregistrement, doit diviser la 
+                            taille d'un secteur
+   Sortie    : SUCCESS (1) ou FAILED (0)
+-*---------------------------------------------------------------------------*/
+bit RingCreate(BootSector *bs, unsigned char *buf, unsigned long secteurDepart, char *filename, RingFile *ring, unsigned long nbClusters, unsigned int recordSize)
+{
+   unsigned int xdata offset = 0;
+   unsigned int xdata clusHi = 0, clusLo = 0;
+   unsigned long xdata first = 0, oldCluster = 0, size = 0;
+   unsigned long xdata entrySector = 0;
+   FileEntry xdata fe;
+   
+   if (recordSize == 0 || recordSize > bs->BytsPerSec || (bs->BytsPerSec % recordSize) != 0) return FAILED;
+   if (nbClusters * bs->SecPerClus < 2) return FAILED;
+   if ((nbClusters * bs->SecPerClus - 1) * (bs->BytsPerSec / recordSize) > RING_MAX_CAPACITY) return FAILED;
+   
+   offset = FindFileEntry(bs, buf, secteurDepart, filename);
+   if (offset == 0) return FAILED;
+   entrySector = secteurDepart + (offset / 512);
+   
+   // Allocation de la nouvelle chaîne
+   first = FindFreeClusterRun(bs, buf, nbClusters);
+   if (first == 0xFFFFFFFF) return FAILED;
+   LinkClusterRun(bs, buf, first, nbClusters);
+   
+   // L'entrée pointe sur la nouvelle chaîne
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, entrySector);
+   fe = ReadFileEntry(buf, offset % 512);
+   oldCluster = ((unsigned long)fe.FstClusHi << 16) | fe.FstClusLO;
+   
+   clusHi = first >> 16;
+   clusLo = first & 0xFFFF;
+   size = nbClusters * bs->SecPerClus * bs->BytsPerSec;
+   STORE_INFO_INT (clusHi, buf, (offset % 512) + FSTCLUSHI_OFFSET)
+   STORE_INFO_INT (clusLo, buf, (offset % 512) + FSTCLUSLO_OFFSET)
+   STORE_INFO_LONG(size,   buf, (offset % 512) + FILESIZE_OFFSET)
+   SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, entrySector);
+   
+   // Libère l'ancienne chaîne après la mise à jour de l'entrée, une
+   // coupure ne laisse que des clusters perdus (voir CheckVolume)
+   FreeClusterChain(bs, buf, oldCluster);
+   
+   ring->headerSector = GetSectorFromCluster(bs, first);
+   ring->recordSize = recordSize;
+   ring->capacity = (nbClusters * bs->SecPerClus - 1) * (bs->BytsPerSec / recordSize);
+   ring->seq = 0;
+   ring->readSeq = 0;
+   
+   WriteRingHeader(bs, buf, ring);
+   
+   return SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*-
+   RingOpen ()
+  -----------------------------------------------------------------------------
+   Descriptif: Ouvre un fichier circulaire créé avec RingCreate. La lecture
+               commence au plus ancien enregistrement.
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour écrire le contenu du secteur
+               secteurDepart : Premier secteur du dossier du fichier
+               filename : nom du fichier
+               ring : Fichier circulaire à initialiser
+   Sortie    : SUCCESS (1) ou FAILED (0)
+-*---------------------------------------------------------------------------*/
+bit RingOpen(BootSector *bs, unsigned char *buf, unsigned long secteurDepart, char *filename, RingFile *ring)
+{
+   unsigned int xdata offset = 0, recPerSec = 0;
+   unsigned long xdata cluster = 0, next = 0, nbClus = 0;
+   unsigned long xdata clusBytes = (unsigned long)bs->BytsPerSec * bs->SecPerClus;
+   unsigned long xdata fatSector = NO_SECTOR;
+   FileEntry xdata fe;
+   
+   offset = FindFileEntry(bs, buf, secteurDepart, filename);
+   if (offset == 0) return FAILED;
+   
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + (offset / 512));
+   fe = ReadFileEntry(buf, offset % 512);
+   cluster = ((unsigned long)fe.FstClusHi << 16) | fe.FstClusLO;
+   if (cluster < 2) return FAILED;
+   
+   ring->headerSector = GetSectorFromCluster(bs, cluster);
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, ring->headerSector);
+   if (memcmp(buf + RING_MAGIC_OFFSET, RING_MAGIC, 4) != 0) return FAILED;
+   
+   PARSE_INFO_INT (ring[0], recordSize, buf, RING_RECSIZE_OFFSET)
+   PARSE_INFO_LONG(ring[0], capacity,   buf, RING_CAPACITY_OFFSET)
+   PARSE_INFO_LONG(ring[0], seq,        buf, RING_SEQ_OFFSET)
+   
+   // L'en-tête ne doit pas faire écrire RingAppend en dehors du fichier
+   if (ring->recordSize == 0 || ring->recordSize > bs->BytsPerSec) return FAILED;
+   if ((bs->BytsPerSec % ring->recordSize) != 0) return FAILED;
+   recPerSec = bs->BytsPerSec / ring->recordSize;
+   if (fe.fileSize / bs->BytsPerSec < 2) return FAILED;
+   if (ring->capacity == 0 || ring->capacity > RING_MAX_CAPACITY) return FAILED;
+   if (ring->capacity > (fe.fileSize / bs->BytsPerSec - 1) * recPerSec) return FAILED;
+   if (ring->seq >= RING_SEQ_LIMIT) return FAILED; // RingAppend le ramène avant
+   
+   // La chaîne doit être restée consécutive (copie ou défragmentation)
+   nbClus = (fe.fileSize / clusBytes) + ((fe.fileSize % clusBytes) != 0);
+   if (cluster + nbClus > GetMaxCluster(bs)) return FAILED;
+   for (; nbClus > 1; nbClus--)
+   {
+      next = GetNextClusterCached(bs, buf, &fatSector, cluster) & CLUSTER_MASK;
+      if (next != cluster + 1) return FAILED;
+      cluster = next;
+   }
+   
+   // Plus ancien enregistrement encore présent
+   ring->readSeq = (ring->seq > ring->capacity) ? ring->seq - ring->capacity : 0;
+   
+   return SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*-
+   RingAppend ()
+  -----------------------------------------------------------------------------
+   Descriptif: Ajoute un enregistrement au fichier circulaire. Le plus ancien
+               est écrasé quand le fichier est plein. Aucune écriture dans la
+               table FAT ou le dossier, seulement le secteur de 
+               l'enregistrement puis l'en-tête.
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour écrire le contenu du secteur
+               ring : Fichier circulaire
+               record : Enregistrement de ring->recordSize bytes
+   Sortie    : --
+-*---------------------------------------------------------------------------*/
+void RingAppend(BootSector *bs, unsigned char *buf, RingFile *ring, unsigned char *record)
+{
+   unsigned int xdata recPerSec = bs->BytsPerSec / ring->recordSize;
+   unsigned long xdata index = ring->seq % ring->capacity;
+   unsigned long xdata sector = ring->headerSector + 1 + (index / recPerSec);
+   unsigned long xdata rebase = 0;
+   
+   // Un enregistrement plus petit qu'un secteur le partage avec d'autres
+   if (recPerSec > 1)
+   {
+      SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+   }
+   memcpy(buf + (index % recPerSec) * ring->recordSize, record, ring->recordSize);
+   SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+   
+   // L'en-tête est écrit après les données, une coupure perd au plus
+   // le dernier enregistrement
+   ring->seq++;
+   
+   // Avant que seq déborde, il est ramené entre capacity et 2 * capacity
+   // sans changer la position dans l'anneau (seq % capacity)
+   if (ring->seq >= RING_SEQ_LIMIT)
+   {
+      rebase = (ring->seq / ring->capacity - 1) * ring->capacity;
+      ring->seq -= rebase;
+      ring->readSeq = (ring->readSeq > rebase) ? ring->readSeq - rebase : 0;
+   }
+   
+   WriteRingHeader(bs, buf, ring);
+}
+
+/*---------------------------------------------------------------------------*-
+   RingRead ()
+  -----------------------------------------------------------------------------
+   Descriptif: Lis le prochain enregistrement du fichier circulaire. Si le
+               lecteur a été dépassé par l'écriture, la lecture reprend au
+               plus ancien enregistrement.
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour écrire le contenu du secteur
+               ring : Fichier circulaire
+               output : Tableau de ring->recordSize bytes
+   Sortie    : SUCCESS (1) ou FAILED (0) s'il n'y a plus d'enregistrement
+-*---------------------------------------------------------------------------*/
+bit RingRead(BootSector *bs, unsigned char *buf, RingFile *ring, unsigned char *output)
+{
+   unsigned int xdata recPerSec = bs->BytsPerSec / ring->recordSize;
+   unsigned long xdata index = 0;
+   
+   if (ring->readSeq == ring->seq) return FAILED;
+   
+   // Lecteur dépassé par l'écriture, reprend au plus ancien enregistrement
+   if (ring->seq - ring->readSeq > ring->capacity)
+   {
+      ring->readSeq = ring->seq - ring->capacity;
+   }
+   
+   index = ring->readSeq % ring->capacity;
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, ring->headerSector + 1 + (index / recPerSec));
+   memcpy(output, buf + (index % recPerSec) * ring->recordSize, ring->recordSize);
+   ring->readSeq++;
+   
+   return SUCCESS;
+}
+
+
+/*---------------------------------------------------------------------------*-
+   DeleteLongName ()
+  -----------------------------------------------------------------------------
+   Descriptif: Supprime les entrées de nom long placées avant une entrée de
+               fichier, si leur checksum correspond au nom court. Sans cela
+               elles restent orphelines quand l'entrée est supprimée ou 
+               renommée.
+
+   Entrée    : buf : Buffer pour écrire le contenu du secteur
+               secteurDepart : Premier secteur du dossier du fichier
+               offset : Offset de l'entrée du fichier (nom court)
+   Sortie    : --
+-*---------------------------------------------------------------------------*/
+static void DeleteLongName(BootSector *bs, unsigned char *buf, unsigned long secteurDepart, unsigned int offset)
+{
+   unsigned long xdata sector = secteurDepart + (offset / 512);
+   unsigned char xdata sum = 0, ord = 1, x = 0;
+   unsigned char *entry;
+   bit dirty = 0;
+   
+   // Checksum du nom court
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+   for (x = 0; x < 11; x++)
+   {
+      sum = ((sum & 1) ? 0x80 : 0) + (sum >> 1) + buf[(offset % 512) + x];
+   }
+   
+   // Les entrées de nom long précèdent le nom court, numérotées depuis 1
+   while (offset >= 32)
+   {
+      offset -= 32;
+      if (secteurDepart + (offset / 512) != sector)
+      {
+         if (dirty) SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+         sector = secteurDepart + (offset / 512);
+         SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+         dirty = 0;
+      }
+      
+      entry = buf + (offset % 512);
+      if (entry[ATTR_OFFSET] != ATTR_LONG_NAME) break;
+      if (entry[0] == DELETED_ENTRY_MARK) break;
+      if ((entry[0] & ~LAST_LONG_ENTRY) != ord) break;
+      if (entry[LDIR_CHKSUM_OFFSET] != sum) break;
+      
+      x = entry[0];
+      entry[0] = DELETED_ENTRY_MARK;
+      dirty = 1;
+      
+      if (x & LAST_LONG_ENTRY) break;
+      ord++;
+   }
+   
+   if (dirty) SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+}
+
+/*---------------------------------------------------------------------------*-
+   FindShortEntry ()
+  -----------------------------------------------------------------------------
+   Descriptif: Cherche dans un dossier l'entrée dont le nom court est 
+               exactement name. Contrairement à FindFileEntry, le nom 
+               n'est pas comparé comme un préfixe.
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour écrire le contenu du secteur
+               secteurDepart : Commence à chercher à ce secteur puis continu sur 1 cluster
+               name : nom sur 11 caractères, donné par FormatFilename
+   Sortie    : Offset du fichier depuis le début du cluster, 0 si absent
+-*---------------------------------------------------------------------------*/
+static unsigned int FindShortEntry(BootSector *bs, unsigned char *buf, unsigned long secteurDepart, unsigned char *name)
+{
+   unsigned int xdata offset = 0;
+   unsigned char xdata secteur = 0, attr = 0;
+   
+   for (secteur = 0; secteur < bs->SecPerClus; secteur++)
+   {
+      SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + secteur);
+      
+      for (offset = 0; offset < 512; offset+=32)
+      {
+         if (buf[offset] == 0x00) return 0; // Fin des entrées
+         if (buf[offset] == DELETED_ENTRY_MARK) continue;
+         
+         // Skip les noms long et le nom du volume
+         attr = buf[offset + ATTR_OFFSET];
+         if ((attr & ATTR_LONG_NAME) == ATTR_LONG_NAME || (attr & ATTR_VOLUME_ID)) continue;
+         
+         if (memcmp(buf + offset + NAME_OFFSET, name, 11) == 0)
+         {
+            return offset + (secteur * 512);
+         }
+      }
+   }
+   
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*-
+   RenameFile ()
+  -----------------------------------------------------------------------------
+   Descriptif: Renomme un fichier ou un dossier. Seule l'entrée est réécrite.
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour écrire le contenu du secteur
+               secteurDepart : Premier secteur du dossier du fichier
+               filename : nom actuel du fichier
+               newname : nouveau nom du fichier
+   Sortie    : SUCCESS (1) ou FAILED (0)
+-*---------------------------------------------------------------------------*/
+bit RenameFile(BootSector *bs, unsigned char *buf, unsigned long secteurDepart, char *filename, char *newname)
+{
+   unsigned char xdata name[11], newName[11];
+   unsigned int xdata offset = 0;
+   
+   if (!FormatFilename(filename, name)) return FAILED;
+   if (!FormatFilename(newname, newName)) return FAILED;
+   if (FindShortEntry(bs, buf, secteurDepart, newName) != 0) return FAILED; // Existe déjà
+   
+   offset = FindShortEntry(bs, buf, secteurDepart, name);
+   if (offset == 0) return FAILED;
+   
+   // L'ancien nom long ne correspond plus au nouveau nom
+   DeleteLongName(bs, buf, secteurDepart, offset);
+   
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + (offset / 512));
+   memcpy(buf + (offset % 512) + NAME_OFFSET, newName, 11);
+   SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + (offset / 512));
+   
+   return SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*-
+   IsInsideDirectory ()
+  -----------------------------------------------------------------------------
+   Descriptif: Remonte les entrées .. depuis un dossier jusqu'à la racine et
+               vérifie si un autre dossier se trouve sur ce chemin
+
+   Entrée    : buf : Buffer pour écrire le contenu du secteur
+               dirCluster : Cluster du dossier de départ (0 pour la racine)
+               cluster : Cluster du dossier cherché
+   Sortie    : 1 si cluster est dirCluster ou un de ses parents, ou si le 
+               chemin est invalide
+-*---------------------------------------------------------------------------*/
+static bit IsInsideDirectory(BootSector *bs, unsigned char *buf, unsigned long dirCluster, unsigned long cluster)
+{
+   unsigned long xdata maxCluster = GetMaxCluster(bs);
+   unsigned long xdata depth = 0;
+   FileEntry xdata fe;
+   
+   while (dirCluster != 0 && dirCluster != bs->RootClus)
+   {
+      if (dirCluster == cluster) return 1;
+      if (dirCluster < 2 || dirCluster >= maxCluster || ++depth >= maxCluster) return 1;
+      
+      // Deuxième entrée du dossier : ..
+      SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, GetSectorFromCluster(bs, dirCluster));
+      if (buf[32] != '.' || buf[33] != '.') return 1;
+      
+      fe = ReadFileEntry(buf, 32);
+      dirCluster = ((unsigned long)fe.FstClusHi << 16) | fe.FstClusLO;
+   }
+   
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*-
+   MoveFile ()
+  -----------------------------------------------------------------------------
+   Descriptif: Déplace un fichier ou un dossier dans un autre dossier. 
+               L'entrée est copiée dans le dossier de destination puis 
+               supprimée de la source, les données ne sont pas copiées.
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour écrire le contenu du secteur
+               secteurSource : Premier secteur du dossier du fichier
+               secteurDest : Premier secteur du dossier de destination
+               filename : nom du fichier
+   Sortie    : SUCCESS (1) ou FAILED (0)
+-*---------------------------------------------------------------------------*/
+bit MoveFile(BootSector *bs, unsigned char *buf, unsigned long secteurSource, unsigned long secteurDest, char *filename)
+{
+   unsigned char xdata entry[32], name[11];
+   unsigned int xdata offset = 0, destOffset = 0;
+   unsigned int xdata clusHi = 0, clusLo = 0;
+   unsigned long xdata cluster = 0, destCluster = 0, sector = 0;
+   bit lastEntry = 0;
+   
+   if (secteurSource == secteurDest) return FAILED;
+   if (!FormatFilename(filename, name)) return FAILED;
+   if (FindShortEntry(bs, buf, secteurDest, name) != 0) return FAILED; // Existe déjà
+   
+   offset = FindShortEntry(bs, buf, secteurSource, name);
+   if (offset == 0) return FAILED;
+   
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurSource + (offset / 512));
+   memcpy(entry, buf + (offset % 512), 32);
+   
+   if (entry[ATTR_OFFSET] & ATTR_DIRECTORY)
+   {
+      memcpy(&clusHi, entry + FSTCLUSHI_OFFSET, 2);
+      memcpy(&clusLo, entry + FSTCLUSLO_OFFSET, 2);
+      SwapEndianINT(&clusHi);
+      SwapEndianINT(&clusLo);
+      cluster = ((unsigned long)clusHi << 16) | clusLo;
+      
+      // La racine est notée 0 dans l'entrée ..
+      if (secteurDest == GetSectorFromCluster(bs, bs->RootClus)) destCluster = 0;
+      else destCluster = (secteurDest - bs->RootDirSector) / bs->SecPerClus + 2;
+      
+      // Un dossier ne peut pas être déplacé dans lui-même ou dans un de
+      // ses sous-dossiers, il ne serait plus accessible depuis la racine
+      if (IsInsideDirectory(bs, buf, destCluster, cluster)) return FAILED;
+   }
+   
+   // ECRITURE DANS LA DESTINATION
+   destOffset = FindFreeEntry(bs, buf, secteurDest);
+   if (destOffset == NO_ENTRY) return FAILED;
+   
+   sector = secteurDest + (destOffset / 512);
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+   lastEntry = (buf[destOffset % 512] == 0x00);
+   memcpy(buf + (destOffset % 512), entry, 32);
+   
+   // L'entrée remplace la fin du dossier, la fin est déplacée à l'entrée suivante
+   if (lastEntry && (destOffset + 32) < (bs->SecPerClus * 512))
+   {
+      if (((destOffset + 32) % 512) != 0)
+      {
+         buf[(destOffset % 512) + 32] = 0x00;
+      }
+      else
+      {
+         SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+         sector++;
+         SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+         buf[0] = 0x00;
+      }
+   }
+   SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+   
+   // Un dossier déplacé doit pointer sur son nouveau parent (entrée ..)
+   if (entry[ATTR_OFFSET] & ATTR_DIRECTORY)
+   {
+      clusHi = destCluster >> 16;
+      clusLo = destCluster & 0xFFFF;
+      
+      SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, GetSectorFromCluster(bs, cluster));
+      if (buf[32] == '.' && buf[33] == '.')
+      {
+         STORE_INFO_INT(clusHi, buf, 32 + FSTCLUSHI_OFFSET)
+         STORE_INFO_INT(clusLo, buf, 32 + FSTCLUSLO_OFFSET)
+         SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, GetSectorFromCluster(bs, cluster));
+      }
+   }
+   
+   // SUPPRESSION DE LA SOURCE
+   // Après l'écriture de la destination, une coupure ne perd pas le fichier
+   // Le nom long est supprimé en premier, son checksum utilise le nom court
+   DeleteLongName(bs, buf, secteurSource, offset);
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurSource + (offset / 512));
+   buf[offset % 512] = DELETED_ENTRY_MARK;
+   SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurSource + (offset / 512));
+   
+   return SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*-
+   FindTailCluster ()
+  -----------------------------------------------------------------------------
+   Descriptif: Parcours nbClus clusters d'une chaîne et retourne le dernier.
+               Chaque cluster est vérifié, une chaîne plus courte que nbClus
+               ou qui pointe en dehors du volume retourne 0.
+
+   Entrée    : fatBuf : Buffer réservé à la table FAT
+               fatSector : Secteur actuellement dans fatBuf
+               cluster : Premier cluster de la chaîne
+               nbClus : Nombre de clusters à parcourir (1 = premier cluster)
+   Sortie    : Numéro du nbClus-ième cluster, 0 si la chaîne est invalide
+-*---------------------------------------------------------------------------*/
+static unsigned long FindTailCluster(BootSector *bs, unsigned char *fatBuf, unsigned long *fatSector, unsigned long cluster, unsigned long nbClus)
+{
+   unsigned long xdata maxCluster = GetMaxCluster(bs);
+   
+   if (cluster < 2 || cluster >= maxCluster) return 0;
+   
+   for (; nbClus > 1; nbClus--)
+   {
+      cluster = GetNextClusterCached(bs, fatBuf, fatSector, cluster) & CLUSTER_MASK;
+      if (cluster < 2 || cluster >= END_OF_CHAIN_MIN || cluster >= maxCluster) return 0;
+   }
+   
+   return cluster;
+}
+
+/*---------------------------------------------------------------------------*-
+   ConcatFiles ()
+  -----------------------------------------------------------------------------
+   Descriptif: Ajoute le contenu d'un fichier à la fin d'un autre, puis 
+               supprime le fichier source. Si la taille de la destination
+               est un multiple de la taille d'un cluster, la chaîne de la
+               source est reliée à la fin de la chaîne de la destination 
+               dans la table FAT, sans copier de données. Sinon, la source 
+               doit tenir dans le dernier cluster de la destination et elle
+               y est copiée.
+
+   Entrée    : bs : Struct boot sector
+               buf : Buffer pour écrire le contenu du secteur
+               buf2 : Buffer pour la table FAT ou la source
+               secteurDepart : Premier secteur du dossier des fichiers
+               filename : nom du fichier de destination
+               srcname : nom du fichier source
+   Sortie    : SUCCESS (1) ou FAILED (0)
+-*---------------------------------------------------------------------------*/
+bit ConcatFiles(BootSector *bs, unsigned char *buf, unsigned char *buf2, unsigned long secteurDepart, char *filename, char *srcname)
+{
+   unsigned char xdata name[11], srcName[11];
+   unsigned int xdata offset = 0, srcOffset = 0;
+   unsigned int xdata clusHi = 0, clusLo = 0;
+   unsigned long xdata clusBytes = (unsigned long)bs->BytsPerSec * bs->SecPerClus;
+   unsigned long xdata cluster = 0, srcCluster = 0, oldCluster = 0, size = 0, srcSize = 0;
+   unsigned long xdata fatSector = NO_SECTOR, loadedSector = NO_SECTOR;
+   unsigned long xdata next = 0, pos = 0, i = 0, sector = 0;
+   FileEntry xdata fe;
+   bit freeSource = 0, newFirst = 0;
+   
+   if (!FormatFilename(filename, name) || !FormatFilename(srcname, srcName)) return FAILED;
+   
+   offset = FindShortEntry(bs, buf, secteurDepart, name);
+   srcOffset = FindShortEntry(bs, buf, secteurDepart, srcName);
+   if (offset == 0 || srcOffset == 0 || offset == srcOffset) return FAILED;
+   
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + (offset / 512));
+   fe = ReadFileEntry(buf, offset % 512);
+   if (buf[(offset % 512) + ATTR_OFFSET] & ATTR_DIRECTORY) return FAILED;
+   cluster = ((unsigned long)fe.FstClusHi << 16) | fe.FstClusLO;
+   size = fe.fileSize;
+   
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + (srcOffset / 512));
+   fe = ReadFileEntry(buf, srcOffset % 512);
+   if (buf[(srcOffset % 512) + ATTR_OFFSET] & ATTR_DIRECTORY) return FAILED;
+   srcCluster = ((unsigned long)fe.FstClusHi << 16) | fe.FstClusLO;
+   srcSize = fe.fileSize;
+   
+   if (size + srcSize < size) return FAILED; // Dépasse 4 GB
+   if (srcSize != 0 && (srcCluster < 2 || srcCluster >= GetMaxCluster(bs))) return FAILED;
+   
+   if (srcSize == 0)
+   {
+      // Rien à ajouter, la source est seulement supprimée
+      freeSource = 1;
+   }
+   else if (size == 0)
+   {
+      // Destination vide, elle reprend la chaîne de la source
+      oldCluster = cluster;
+      cluster = srcCluster;
+      newFirst = 1;
+   }
+   else if ((size % clusBytes) == 0)
+   {
+      // Dernier cluster de la destination, 1 lecture par secteur de la table FAT
+      cluster = FindTailCluster(bs, buf2, &fatSector, cluster, size / clusBytes);
+      if (cluster == 0) return FAILED;
+      
+      // WriteFile laisse un cluster vide après un fichier qui remplit 
+      // son dernier cluster, il serait perdu par la liaison
+      next = GetNextClusterCached(bs, buf2, &fatSector, cluster) & CLUSTER_MASK;
+      if (next >= 2 && next < END_OF_CHAIN_MIN && next < GetMaxCluster(bs))
+      {
+         FreeClusterChain(bs, buf2, next);
+      }
+      SetClusterValue(bs, buf2, cluster, srcCluster);
+   }
+   else if (srcSize <= clusBytes - (size % clusBytes))
+   {
+      // La source tient dans le dernier cluster de la destination
+      cluster = FindTailCluster(bs, buf2, &fatSector, cluster, size / clusBytes + 1);
+      if (cluster == 0) return FAILED;
+      
+      pos = size % clusBytes;
+      i = 0;
+      while (i < srcSize)
+      {
+         sector = GetSectorFromCluster(bs, cluster) + ((pos + i) / bs->BytsPerSec);
+         SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+         
+         do
+         {
+            if (loadedSector != GetSectorFromCluster(bs, srcCluster) + (i / bs->BytsPerSec))
+            {
+               loadedSector = GetSectorFromCluster(bs, srcCluster) + (i / bs->BytsPerSec);
+               SD_ReadBlock(TOKEN_RW, buf2, bs->BytsPerSec, loadedSector);
+            }
+            buf[(pos + i) % bs->BytsPerSec] = buf2[i % bs->BytsPerSec];
+            i++;
+         } while (i < srcSize && ((pos + i) % bs->BytsPerSec) != 0);
+         
+         SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, sector);
+      }
+      
+      freeSource = 1;
+   }
+   else
+   {
+      return FAILED;
+   }
+   
+   // TAILLE DE LA DESTINATION
+   size += srcSize;
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + (offset / 512));
+   if (newFirst)
+   {
+      clusHi = cluster >> 16;
+      clusLo = cluster & 0xFFFF;
+      STORE_INFO_INT(clusHi, buf, (offset % 512) + FSTCLUSHI_OFFSET)
+      STORE_INFO_INT(clusLo, buf, (offset % 512) + FSTCLUSLO_OFFSET)
+   }
+   STORE_INFO_LONG(size, buf, (offset % 512) + FILESIZE_OFFSET)
+   SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + (offset / 512));
+   
+   // SUPPRESSION DE LA SOURCE
+   DeleteLongName(bs, buf, secteurDepart, srcOffset);
+   SD_ReadBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + (srcOffset / 512));
+   buf[srcOffset % 512] = DELETED_ENTRY_MARK;
+   SD_WriteBlock(TOKEN_RW, buf, bs->BytsPerSec, secteurDepart + (srcOffset / 512));
+   
+   if (freeSource)
+   {
+      FreeClusterChain(bs, buf, srcCluster);
+   }
+   if (newFirst)
+   {
+      FreeClusterChain(bs, buf, oldCluster);
+   }
+   
+   return SUCCESS;
+}
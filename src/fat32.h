@@ -28,6 +28,30 @@
 #define NUMFATS_OFFSET    		0x10 // 16
 #define FATSz32_OFFSET    		0x24 // 36
 #define ROOTCLUS_OFFSET   		0x2C // 44
+#define MEDIA_OFFSET      		0x15 // 21
+#define SECPERTRK_OFFSET  		0x18 // 24
+#define NUMHEADS_OFFSET   		0x1A // 26
+#define TOTSEC32_OFFSET   		0x20 // 32
+#define FSINFO_OFFSET     		0x30 // 48
+#define BKBOOTSEC_OFFSET  		0x32 // 50
+#define DRVNUM_OFFSET     		0x40 // 64
+#define BOOTSIG_OFFSET    		0x42 // 66
+#define VOLID_OFFSET      		0x43 // 67
+#define VOLLAB_OFFSET     		0x47 // 71
+#define FILSYSTYPE_OFFSET 		0x52 // 82
+#define SIGNATURE_OFFSET  		0x1FE // 510
+
+// FSINFO
+#define FSI_LEADSIG_OFFSET   	0x000 // 0
+#define FSI_STRUCSIG_OFFSET  	0x1E4 // 484
+#define FSI_FREECOUNT_OFFSET 	0x1E8 // 488
+#define FSI_NXTFREE_OFFSET   	0x1EC // 492
+#define FSI_TRAILSIG_OFFSET  	0x1FC // 508
+
+#define FSI_LEADSIG          	0x41615252
+#define FSI_STRUCSIG         	0x61417272
+#define FSI_TRAILSIG         	0xAA550000
+#define FSI_UNKNOWN          	0xFFFFFFFF
 
 // DIR ENTRY
 #define NAME_OFFSET          	0x00 // 00
@@ -41,6 +65,33 @@
 #define WRTDATE_OFFSET       	0x18 // 24
 #define FSTCLUSLO_OFFSET     	0x1A // 26
 #define FILESIZE_OFFSET      	0x1C // 28
+#define LDIR_CHKSUM_OFFSET   	0x0D // 13 (entrée de nom long)
+
+// DIR ENTRY ATTRIBUTES
+#define ATTR_VOLUME_ID       	0x08
+#define ATTR_DIRECTORY       	0x10
+#define ATTR_LONG_NAME       	0x0F
+#define DELETED_ENTRY_MARK   	0xE5
+#define LAST_LONG_ENTRY      	0x40
+#define INVALID_NAME_CHARS   	" \"*+,./:;<=>?[\\]|" // Refusés dans un nom court
+
+// FORMAT
+#define FSINFO_SECTOR        	1
+#define BACKUP_BOOT_SECTOR   	6
+#define MIN_RSVD_SECTORS     	32
+#define MIN_FAT32_CLUSTERS   	65525
+#define DEFAULT_VOLUME_LABEL 	"NO NAME    "
+
+
+// RING FILE (en-tête dans le premier secteur du fichier)
+#define RING_MAGIC_OFFSET    	0x00 // 0
+#define RING_RECSIZE_OFFSET  	0x04 // 4
+#define RING_CAPACITY_OFFSET 	0x08 // 8
+#define RING_SEQ_OFFSET      	0x0C // 12
+
+#define RING_MAGIC           	"RING"
+#define RING_SEQ_LIMIT       	0xF0000000 // seq est ramené avant de déborder
+#define RING_MAX_CAPACITY    	(RING_SEQ_LIMIT / 2)
 
 
 // FILE SEEK
@@ -49,16 +100,34 @@
 
 
 #define END_OF_FILE_MARK 0x0FFFFFFF
+#define END_OF_CHAIN_MIN 0x0FFFFFF8
+#define BAD_CLUSTER_MARK 0x0FFFFFF7
+#define CLUSTER_MASK     0x0FFFFFFF
+#define NO_SECTOR        0xFFFFFFFF
+#define NO_ENTRY         0xFFFF
+
+
+// CHECK VOLUME
+#define CHECK_MAX_DEPTH  8          // Profondeur maximum des dossiers vérifiés
+#define CHAIN_ANY_LENGTH 0xFFFFFFFF // Longueur de chaîne non connue (dossier)
+
+#define CHAIN_OK          0
+#define CHAIN_SHORT       1
+#define CHAIN_TOO_LONG    2
+#define CHAIN_BROKEN      3
+#define CHAIN_CROSSLINKED 4
 
 // MACROS
 #define PARSE_INFO_INT(structure, info, buffer, offset)  memcpy(&structure.info, buffer+offset, sizeof(structure.info)); SwapEndianINT(&structure.info);
 #define PARSE_INFO_LONG(structure, info, buffer, offset) memcpy(&structure.info, buffer+offset, sizeof(structure.info)); SwapEndianLONG(&structure.info);
 #define PARSE_INFO_CHAR(structure, info, buffer, offset) memcpy(&structure.info, buffer+offset, sizeof(structure.info));
+#define STORE_INFO_INT(value, buffer, offset)  SwapEndianINT(&value); memcpy(buffer+offset, &value, sizeof(value)); SwapEndianINT(&value);
+#define STORE_INFO_LONG(value, buffer, offset) SwapEndianLONG(&value); memcpy(buffer+offset, &value, sizeof(value)); SwapEndianLONG(&value);
 
 sbit DEBUG_3 = P2^6;
 
 // Informations utiles du Boot sector 
-// Taille de la struct : 16 bytes
+// Taille de la struct : 22 bytes
 typedef struct 
 {
 	unsigned int  BytsPerSec;
@@ -67,7 +136,8 @@ typedef struct
 	unsigned char NumFATs;
 	unsigned long FATSz32;
 	unsigned long RootClus;
-	unsigned int  RootDirSector;  // Not really in the boot sector
+	unsigned long TotSec32;
+	unsigned long RootDirSector;  // Not really in the boot sector
 } BootSector;
 
 
@@ -98,6 +168,37 @@ typedef struct
    unsigned char currentSector;
 } FileInfo;
 
+// Résultat de la vérification du volume (CheckVolume)
+typedef struct
+{
+   unsigned long crossLinked;  // Chaînes qui partagent un cluster avec une autre
+   unsigned long brokenChains; // Chaînes qui pointent vers un cluster invalide
+   unsigned long sizeMismatch; // Taille du fichier différente de la longueur de la chaîne
+   unsigned long lostClusters; // Clusters alloués qui n'appartiennent à aucun fichier
+   unsigned long fatMismatch;  // Secteurs différents entre les copies de la table FAT
+   unsigned long checkedClusters; // Clusters de la région vérifiée, 0 si région invalide
+   unsigned int  skippedDirs;  // Dossiers trop profonds, non vérifiés
+} CheckReport;
+
+// Position dans un dossier pendant le parcours de CheckVolume
+typedef struct
+{
+   unsigned long cluster;
+   unsigned long remaining; // Nombre de clusters restants dans la chaîne
+   unsigned int  offset;
+   unsigned char sector;
+} DirCursor;
+
+// Fichier circulaire, enregistrements de taille fixe
+typedef struct
+{
+   unsigned long headerSector; // Premier secteur du fichier, contient l'en-tête
+   unsigned long capacity;     // Nombre d'enregistrements dans l'anneau
+   unsigned long seq;          // Nombre d'enregistrements écrits depuis la création
+   unsigned long readSeq;      // Prochain enregistrement à lire
+   unsigned int  recordSize;
+} RingFile;
+
 // Fonction d'abstraction
 extern bit SD_ReadBlock(unsigned char token, unsigned char *buf, unsigned int nbBytes, unsigned long sectorAddr);
 extern bit SD_WriteBlock(unsigned char token, unsigned char *buf, unsigned int nbBytes, unsigned long blkAddr);
@@ -114,17 +215,40 @@ void WriteFile(BootSector *bs, unsigned char *buf, FileInfo *fi, FileEntry *fe,
 
 
 unsigned char CleanFilename(char *filename);
+bit FormatFilename(char *filename, unsigned char *name);
 unsigned long GetNextClusterValue(BootSector *bs, unsigned char *buf, unsigned long clusterNumber);
 void SetNextClusterValue(BootSector *bs, unsigned char *buf, unsigned long clusterNumber, unsigned long nextClusterNumber);
 unsigned long GetSectorFromCluster(BootSector *bs, unsigned long cluster);
+unsigned long GetMaxCluster(BootSector *bs);
 unsigned long FindFreeCluster(BootSector *bs, unsigned char *buf);
+unsigned long FindFreeClusterRun(BootSector *bs, unsigned char *buf, unsigned long nbClusters);
+void FreeClusterChain(BootSector *bs, unsigned char *buf, unsigned long cluster);
 unsigned int FindFileEntry(BootSector *bs, char *buf, unsigned long secteurDepart, char *filename);
+unsigned int FindFreeEntry(BootSector *bs, unsigned char *buf, unsigned long secteurDepart);
 void ListFilesDirectory(BootSector *bs, unsigned char *buf, unsigned char *texte, unsigned long secteurDepart);
+void SetClusterValue(BootSector *bs, unsigned char *buf, unsigned long clusterNumber, unsigned long value);
+unsigned long GetNextClusterCached(BootSector *bs, unsigned char *buf, unsigned long *bufSector, unsigned long clusterNumber);
 
 
 BootSector ParseBootSector(unsigned char *buf);
+bit FormatVolume(unsigned char *buf, unsigned long totalSectors, unsigned long eraseBlockSectors);
 FileEntry ReadFileEntry(unsigned char *buf, unsigned int offset);
 
+// Vérification du volume
+unsigned long CompareFATCopies(BootSector *bs, unsigned char *buf, unsigned char *buf2, unsigned long firstSector, unsigned long nbSectors, bit repair);
+CheckReport CheckVolume(BootSector *bs, unsigned char *buf, unsigned char *fatBuf, unsigned char *bitmap, unsigned long firstCluster, unsigned long nbClusters, bit repair);
+
+// Fichier circulaire
+bit RingCreate(BootSector *bs, unsigned char *buf, unsigned long secteurDepart, char *filename, RingFile *ring, unsigned long nbClusters, unsigned int recordSize);
+bit RingOpen(BootSector *bs, unsigned char *buf, unsigned long secteurDepart, char *filename, RingFile *ring);
+void RingAppend(BootSector *bs, unsigned char *buf, RingFile *ring, unsigned char *record);
+bit RingRead(BootSector *bs, unsigned char *buf, RingFile *ring, unsigned char *output);
+
+// Renommer, déplacer, concaténer
+bit RenameFile(BootSector *bs, unsigned char *buf, unsigned long secteurDepart, char *filename, char *newname);
+bit MoveFile(BootSector *bs, unsigned char *buf, unsigned long secteurSource, unsigned long secteurDest, char *filename);
+bit ConcatFiles(BootSector *bs, unsigned char *buf, unsigned char *buf2, unsigned long secteurDepart, char *filename, char *srcname);
+
 #endif
 
 